@@ -37,6 +37,8 @@
 #include <map>
 #include <list>
 #include <bitset>
+#include <chrono>
+#include <thread>
 // BOOST
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
@@ -47,6 +49,9 @@
 #include "miniDHT_proto.pb.h"
 #include "miniDHT_session.h"
 #include "miniDHT_db.h"
+#if defined(MINIDHT_LOG_STORAGE)
+#include "miniDHT_log.h"
+#endif
 #include "miniDHT_const.h"
 #include "miniDHT_bucket.h"
 #include "miniDHT_search.h"
@@ -58,6 +63,12 @@ namespace miniDHT {
 	public :
 
 		typedef uint32_t token_t;
+		// both have the same interface, the log is POSIX only
+#if defined(MINIDHT_LOG_STORAGE)
+		typedef db_log_data storage_t;
+#else
+		typedef db_multi_key_data storage_t;
+#endif
 		typedef std::string key_t;
 		typedef search search_t;
 		typedef bucket bucket_t;
@@ -92,7 +103,7 @@ namespace miniDHT {
 		// search list
 		std::map<token_t, search_t> map_search;
 		// key related storage
-		db_multi_key_data db_storage;
+		storage_t db_storage;
 		db_key_value db_backup;
 		// token related storage
 		std::map<token_t, boost::posix_time::ptime> map_ping_ttl;
@@ -0,0 +1,924 @@
+/*
+ * Copyright (c) 2009-2019, Frederic DUBOUCHET
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the CERN nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Frederic DUBOUCHET ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Frederic DUBOUCHET BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "miniDHT_log.h"
+#include <boost/filesystem.hpp>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace miniDHT {
+
+	namespace {
+
+		// record layout (little endian) :
+		//   0 magic, 4 crc32 of [8, length), 8 type, 12 key size,
+		//   16 title size, 20 data size, 24 time, 32 ttl, 40 key title data
+		const uint32_t RECORD_MAGIC = 0x5448446d; // "mDHT"
+		const uint32_t INDEX_MAGIC = 0x4948446d; // "mDHI"
+		const size_t RECORD_HEADER_SIZE = 40;
+		// index layout : 0 magic, 4 crc32 of [8, end), 8 segment, 12 offset
+		// 20 count, 28 entries
+		const size_t INDEX_HEADER_SIZE = 28;
+		const size_t INDEX_ENTRY_SIZE = 40;
+
+		void put_u32(char* p, uint32_t v) {
+			for (int i = 0; i < 4; ++i) p[i] = (char)((v >> (i * 8)) & 0xff);
+		}
+
+		void put_u64(char* p, uint64_t v) {
+			for (int i = 0; i < 8; ++i) p[i] = (char)((v >> (i * 8)) & 0xff);
+		}
+
+		uint32_t get_u32(const char* p) {
+			uint32_t v = 0;
+			for (int i = 3; i >= 0; --i) v = (v << 8) | (unsigned char)p[i];
+			return v;
+		}
+
+		uint64_t get_u64(const char* p) {
+			uint64_t v = 0;
+			for (int i = 7; i >= 0; --i) v = (v << 8) | (unsigned char)p[i];
+			return v;
+		}
+
+		uint32_t checksum(const char* p, size_t s) {
+			uLong crc = crc32(0L, Z_NULL, 0);
+			return (uint32_t)crc32(crc, (const Bytef*)p, (uInt)s);
+		}
+
+		// whole record length from its header
+		uint64_t record_length(const char* p) {
+			return RECORD_HEADER_SIZE +
+				(uint64_t)get_u32(p + 12) +
+				(uint64_t)get_u32(p + 16) +
+				(uint64_t)get_u32(p + 20);
+		}
+
+		struct record_t {
+			int type;
+			std::string key;
+			std::string title;
+			long long time;
+			long long ttl;
+			size_t data_offset;
+			size_t data_size;
+		};
+
+		void decode_record(const std::string& buf, record_t& rec) {
+			const char* p = buf.data();
+			rec.type = (unsigned char)p[8];
+			uint32_t key_size = get_u32(p + 12);
+			uint32_t title_size = get_u32(p + 16);
+			rec.data_size = get_u32(p + 20);
+			rec.time = (long long)get_u64(p + 24);
+			rec.ttl = (long long)get_u64(p + 32);
+			rec.key.assign(p + RECORD_HEADER_SIZE, key_size);
+			rec.title.assign(p + RECORD_HEADER_SIZE + key_size, title_size);
+			rec.data_offset = RECORD_HEADER_SIZE + key_size + title_size;
+		}
+
+		bool is_expired(long long time, long long ttl, long long now) {
+			return (time + ttl) < now;
+		}
+
+		long long now_time() {
+			return (long long)miniDHT::to_time_t(update_time());
+		}
+
+	}
+
+	db_log_data::db_log_data()
+		:	prefix_(""),
+			max_segment_size_(DEFAULT_SEGMENT_SIZE),
+			compact_ratio_(DEFAULT_COMPACT_RATIO),
+			active_fd_(-1),
+			active_segment_(0),
+			active_offset_(0),
+			compact_thread_(NULL),
+			compact_stop_(false) {}
+
+	db_log_data::db_log_data(const std::string& prefix)
+		:	prefix_(""),
+			max_segment_size_(DEFAULT_SEGMENT_SIZE),
+			compact_ratio_(DEFAULT_COMPACT_RATIO),
+			active_fd_(-1),
+			active_segment_(0),
+			active_offset_(0),
+			compact_thread_(NULL),
+			compact_stop_(false)
+	{
+		open(prefix);
+	}
+
+	db_log_data::~db_log_data() {
+		close();
+	}
+
+	std::string db_log_data::segment_path(uint32_t segment) const {
+		char temp[16];
+		sprintf(temp, "%08u", segment);
+		std::stringstream ss("");
+		ss << prefix_ << "." << temp << ".seg";
+		return ss.str();
+	}
+
+	std::string db_log_data::index_path() const {
+		return prefix_ + ".idx";
+	}
+
+	void db_log_data::open(const std::string& prefix) {
+		close();
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		prefix_ = prefix;
+		index_clear_nolock();
+		map_segment_size_.clear();
+		// find the segments belonging to this prefix
+		boost::filesystem::path prefix_path(prefix_);
+		boost::filesystem::path dir = prefix_path.parent_path();
+		if (dir.empty()) dir = ".";
+		const std::string base = prefix_path.filename().string() + ".";
+		boost::filesystem::directory_iterator end;
+		for (boost::filesystem::directory_iterator ite(dir); ite != end; ++ite) {
+			std::string name = ite->path().filename().string();
+			if (name.size() != base.size() + 12) continue;
+			if (name.compare(0, base.size(), base)) continue;
+			if (name.compare(name.size() - 4, 4, ".seg")) continue;
+			uint32_t segment = (uint32_t)strtoul(
+				name.substr(base.size(), 8).c_str(), NULL, 10);
+			map_segment_size_[segment] =
+				(uint64_t)boost::filesystem::file_size(ite->path());
+		}
+		// load the index and replay what was written after it
+		uint32_t last_segment = 0;
+		if (!map_segment_size_.empty())
+			last_segment = map_segment_size_.rbegin()->first;
+		uint32_t mark_segment = 0;
+		uint64_t mark_offset = 0;
+		{
+			std::ifstream ifs(index_path().c_str(), std::ios::binary);
+			std::string buf(
+				(std::istreambuf_iterator<char>(ifs)),
+				std::istreambuf_iterator<char>());
+			if (!load_index_buffer(buf, mark_segment, mark_offset)) {
+				index_clear_nolock();
+				mark_segment = 0;
+				mark_offset = 0;
+			}
+		}
+		std::map<uint32_t, uint64_t>::iterator ite;
+		for (ite = map_segment_size_.begin();
+			ite != map_segment_size_.end();
+			++ite)
+		{
+			if (ite->first < mark_segment) continue;
+			scan_segment(
+				ite->first,
+				(ite->first == mark_segment) ? mark_offset : 0,
+				ite->first == last_segment);
+		}
+		if (last_segment &&
+			map_segment_size_[last_segment] < max_segment_size_)
+			open_active(last_segment);
+		else
+			open_active(last_segment + 1);
+		compact_stop_ = false;
+		compact_thread_ = new boost::thread(
+			boost::bind(&db_log_data::compact_loop, this));
+	}
+
+	void db_log_data::close() {
+		if (compact_thread_) {
+			{
+				boost::mutex::scoped_lock lock_it(local_lock_);
+				compact_stop_ = true;
+				compact_cond_.notify_all();
+			}
+			compact_thread_->join();
+			delete compact_thread_;
+			compact_thread_ = NULL;
+		}
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		if (active_fd_ < 0) return;
+		fsync(active_fd_);
+		save_index_nolock();
+		std::map<uint32_t, int>::iterator ite;
+		for (ite = map_segment_fd_.begin(); ite != map_segment_fd_.end(); ++ite)
+			if (ite->second != active_fd_) ::close(ite->second);
+		map_segment_fd_.clear();
+		::close(active_fd_);
+		active_fd_ = -1;
+	}
+
+	void db_log_data::clear() {
+		close();
+		{
+			std::map<uint32_t, uint64_t>::iterator ite;
+			for (ite = map_segment_size_.begin();
+				ite != map_segment_size_.end();
+				++ite)
+				::remove(segment_path(ite->first).c_str());
+			::remove(index_path().c_str());
+		}
+		open(prefix_);
+	}
+
+	int db_log_data::segment_fd(uint32_t segment) {
+		if (segment == active_segment_) return active_fd_;
+		std::map<uint32_t, int>::iterator ite = map_segment_fd_.find(segment);
+		if (ite != map_segment_fd_.end()) return ite->second;
+		int fd = ::open(segment_path(segment).c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error(
+				"Could not open segment : " + segment_path(segment));
+		map_segment_fd_[segment] = fd;
+		return fd;
+	}
+
+	void db_log_data::open_active(uint32_t segment) {
+		if (active_fd_ >= 0) {
+			fsync(active_fd_);
+			// keep it around for reading
+			map_segment_fd_[active_segment_] = active_fd_;
+		}
+		std::map<uint32_t, int>::iterator ite = map_segment_fd_.find(segment);
+		if (ite != map_segment_fd_.end()) {
+			::close(ite->second);
+			map_segment_fd_.erase(ite);
+		}
+		active_fd_ = ::open(
+			segment_path(segment).c_str(),
+			O_RDWR | O_CREAT,
+			0644);
+		if (active_fd_ < 0)
+			throw std::runtime_error(
+				"Could not open segment : " + segment_path(segment));
+		active_segment_ = segment;
+		active_offset_ = map_segment_size_[segment];
+	}
+
+	uint64_t db_log_data::append_nolock(
+		record_type_t type,
+		const std::string& key,
+		const std::string& title,
+		const long long& time,
+		const long long& ttl,
+		const char* data,
+		size_t data_size)
+	{
+		const size_t length =
+			RECORD_HEADER_SIZE + key.size() + title.size() + data_size;
+		if (active_offset_ && (active_offset_ + length > max_segment_size_))
+			open_active(active_segment_ + 1);
+		std::string buf(length, '\0');
+		char* p = &buf[0];
+		put_u32(p, RECORD_MAGIC);
+		p[8] = (char)type;
+		put_u32(p + 12, (uint32_t)key.size());
+		put_u32(p + 16, (uint32_t)title.size());
+		put_u32(p + 20, (uint32_t)data_size);
+		put_u64(p + 24, (uint64_t)time);
+		put_u64(p + 32, (uint64_t)ttl);
+		memcpy(p + RECORD_HEADER_SIZE, key.data(), key.size());
+		memcpy(p + RECORD_HEADER_SIZE + key.size(), title.data(), title.size());
+		if (data_size)
+			memcpy(
+				p + RECORD_HEADER_SIZE + key.size() + title.size(),
+				data,
+				data_size);
+		put_u32(p + 4, checksum(p + 8, length - 8));
+		// a failed write leave the offset unchanged so the next record
+		// overwrite the partial one.
+		size_t written = 0;
+		while (written < length) {
+			long long rc = pwrite(
+				active_fd_,
+				p + written,
+				length - written,
+				active_offset_ + written);
+			if (rc <= 0)
+				throw std::runtime_error(
+					"Could not write to segment : " +
+					segment_path(active_segment_));
+			written += (size_t)rc;
+		}
+		uint64_t offset = active_offset_;
+		active_offset_ += length;
+		map_segment_size_[active_segment_] = active_offset_;
+		return offset;
+	}
+
+	void db_log_data::read_nolock(
+		const log_location_t& loc,
+		std::string& record)
+	{
+		record.resize(loc.length);
+		long long rc = pread(
+			segment_fd(loc.segment),
+			&record[0],
+			loc.length,
+			loc.offset);
+		if ((rc != (long long)loc.length) ||
+			(loc.length < RECORD_HEADER_SIZE) ||
+			(get_u32(record.data()) != RECORD_MAGIC) ||
+			(get_u32(record.data() + 4) !=
+				checksum(record.data() + 8, loc.length - 8)))
+		{
+			std::stringstream ss("");
+			ss << "Corrupted record in segment : ";
+			ss << segment_path(loc.segment) << " at " << loc.offset;
+			throw std::runtime_error(ss.str());
+		}
+	}
+
+	void db_log_data::read_item_nolock(
+		map_index_iterator ite,
+		data_item_proto& out)
+	{
+		std::string record;
+		read_nolock(ite->second, record);
+		record_t rec;
+		decode_record(record, rec);
+		out.set_time(ite->second.time);
+		out.set_ttl(ite->second.ttl);
+		out.set_title(ite->first.second);
+		out.set_data(record.data() + rec.data_offset, rec.data_size);
+	}
+
+	void db_log_data::index_link_nolock(map_index_iterator ite) {
+		const log_location_t& loc = ite->second;
+		map_segment_live_[loc.segment] += loc.length;
+	}
+
+	void db_log_data::index_unlink_nolock(map_index_iterator ite) {
+		const log_location_t& loc = ite->second;
+		map_segment_live_[loc.segment] -= loc.length;
+	}
+
+	void db_log_data::index_put_nolock(
+		const log_key_t& lk,
+		const log_location_t& loc)
+	{
+		map_index_iterator ite = index_.find(lk);
+		if (ite == index_.end()) {
+			ite = index_.insert(std::make_pair(lk, loc)).first;
+		} else {
+			// the previous value is now dead
+			index_unlink_nolock(ite);
+			ite->second = loc;
+		}
+		index_link_nolock(ite);
+	}
+
+	void db_log_data::index_erase_nolock(map_index_iterator ite) {
+		index_unlink_nolock(ite);
+		index_.erase(ite);
+	}
+
+	void db_log_data::index_touch_nolock(
+		map_index_iterator ite,
+		const long long& time,
+		const long long& ttl)
+	{
+		ite->second.time = time;
+		ite->second.ttl = ttl;
+	}
+
+	void db_log_data::index_clear_nolock() {
+		index_.clear();
+		map_segment_live_.clear();
+	}
+
+	void db_log_data::scan_segment(
+		uint32_t segment,
+		uint64_t from,
+		bool is_last)
+	{
+		const uint64_t size = map_segment_size_[segment];
+		int fd = ::open(
+			segment_path(segment).c_str(),
+			(is_last ? O_RDWR : O_RDONLY));
+		if (fd < 0)
+			throw std::runtime_error(
+				"Could not open segment : " + segment_path(segment));
+		const long long now = now_time();
+		uint64_t offset = from;
+		std::string buf;
+		while (offset + RECORD_HEADER_SIZE <= size) {
+			buf.resize(RECORD_HEADER_SIZE);
+			if (pread(fd, &buf[0], RECORD_HEADER_SIZE, offset) !=
+				(long long)RECORD_HEADER_SIZE)
+				break;
+			if (get_u32(buf.data()) != RECORD_MAGIC) break;
+			uint64_t length = record_length(buf.data());
+			if (offset + length > size) break;
+			buf.resize((size_t)length);
+			if (pread(fd, &buf[0], (size_t)length, offset) != (long long)length)
+				break;
+			if (get_u32(&buf[4]) != checksum(&buf[8], (size_t)length - 8))
+				break;
+			record_t rec;
+			decode_record(buf, rec);
+			log_key_t lk(rec.key, rec.title);
+			map_index_iterator ite = index_.find(lk);
+			switch (rec.type) {
+				case RECORD_PUT :
+					if (is_expired(rec.time, rec.ttl, now)) {
+						if (ite != index_.end()) index_erase_nolock(ite);
+					} else {
+						log_location_t loc;
+						loc.segment = segment;
+						loc.offset = offset;
+						loc.length = (uint32_t)length;
+						loc.time = rec.time;
+						loc.ttl = rec.ttl;
+						index_put_nolock(lk, loc);
+					}
+					break;
+				case RECORD_DELETE :
+					if (ite != index_.end()) index_erase_nolock(ite);
+					break;
+				case RECORD_TOUCH :
+					if (ite != index_.end())
+						index_touch_nolock(ite, rec.time, rec.ttl);
+					break;
+				default :
+					break;
+			}
+			offset += length;
+		}
+		if (offset < size) {
+			std::cerr
+				<< "Segment " << segment_path(segment)
+				<< " is damaged after offset " << offset;
+			if (is_last) {
+				// torn write at the end of the log, drop it
+				std::cerr << " (truncated)";
+				if (ftruncate(fd, (long long)offset) == 0)
+					map_segment_size_[segment] = offset;
+			}
+			std::cerr << std::endl;
+		}
+		::close(fd);
+	}
+
+	bool db_log_data::load_index_buffer(
+		const std::string& buf,
+		uint32_t& mark_segment,
+		uint64_t& mark_offset)
+	{
+		if (buf.size() < INDEX_HEADER_SIZE) return false;
+		const char* p = buf.data();
+		if (get_u32(p) != INDEX_MAGIC) return false;
+		if (get_u32(p + 4) != checksum(p + 8, buf.size() - 8)) return false;
+		mark_segment = get_u32(p + 8);
+		mark_offset = get_u64(p + 12);
+		uint64_t count = get_u64(p + 20);
+		// the mark has to be in the log
+		if (map_segment_size_.find(mark_segment) == map_segment_size_.end())
+			return false;
+		if (map_segment_size_[mark_segment] < mark_offset) return false;
+		size_t pos = INDEX_HEADER_SIZE;
+		for (uint64_t i = 0; i < count; ++i) {
+			if (pos + INDEX_ENTRY_SIZE > buf.size()) return false;
+			log_location_t loc;
+			loc.segment = get_u32(p + pos);
+			loc.offset = get_u64(p + pos + 4);
+			loc.length = get_u32(p + pos + 12);
+			loc.time = (long long)get_u64(p + pos + 16);
+			loc.ttl = (long long)get_u64(p + pos + 24);
+			uint32_t key_size = get_u32(p + pos + 32);
+			uint32_t title_size = get_u32(p + pos + 36);
+			pos += INDEX_ENTRY_SIZE;
+			if (pos + key_size + title_size > buf.size()) return false;
+			// a segment was removed (compaction) after the index was saved
+			if (map_segment_size_.find(loc.segment) == map_segment_size_.end())
+				return false;
+			log_key_t lk(
+				std::string(p + pos, key_size),
+				std::string(p + pos + key_size, title_size));
+			pos += key_size + title_size;
+			index_put_nolock(lk, loc);
+		}
+		return true;
+	}
+
+	void db_log_data::save_index_nolock() {
+		std::string buf(INDEX_HEADER_SIZE, '\0');
+		put_u32(&buf[0], INDEX_MAGIC);
+		put_u32(&buf[8], active_segment_);
+		put_u64(&buf[12], active_offset_);
+		put_u64(&buf[20], (uint64_t)index_.size());
+		char entry[INDEX_ENTRY_SIZE];
+		map_index_iterator ite;
+		for (ite = index_.begin(); ite != index_.end(); ++ite) {
+			put_u32(entry, ite->second.segment);
+			put_u64(entry + 4, ite->second.offset);
+			put_u32(entry + 12, ite->second.length);
+			put_u64(entry + 16, (uint64_t)ite->second.time);
+			put_u64(entry + 24, (uint64_t)ite->second.ttl);
+			put_u32(entry + 32, (uint32_t)ite->first.first.size());
+			put_u32(entry + 36, (uint32_t)ite->first.second.size());
+			buf.append(entry, INDEX_ENTRY_SIZE);
+			buf.append(ite->first.first);
+			buf.append(ite->first.second);
+		}
+		put_u32(&buf[4], checksum(&buf[8], buf.size() - 8));
+		// write aside then rename so a crash never leave half an index
+		const std::string temp_path = index_path() + ".tmp";
+		{
+			std::ofstream ofs(temp_path.c_str(), std::ios::binary);
+			ofs.write(buf.data(), buf.size());
+			if (!ofs) {
+				std::cerr
+					<< "Could not save index : " << temp_path
+					<< std::endl;
+				return;
+			}
+		}
+		::remove(index_path().c_str());
+		::rename(temp_path.c_str(), index_path().c_str());
+	}
+
+	void db_log_data::find(
+		const std::string& key,
+		std::list<data_item_proto>& out)
+	{
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		map_index_iterator ite = index_.lower_bound(log_key_t(key, ""));
+		for (; ite != index_.end() && ite->first.first == key; ++ite) {
+			data_item_proto di;
+			read_item_nolock(ite, di);
+			out.push_back(di);
+		}
+	}
+
+	void db_log_data::find(
+		const std::string& key,
+		const std::string& title,
+		data_item_proto& out)
+	{
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		map_index_iterator ite = index_.find(log_key_t(key, title));
+		if (ite == index_.end()) {
+			std::stringstream ss("");
+			ss << "No record for [" << key << ", " << title << "]";
+			throw std::runtime_error(ss.str());
+		}
+		read_item_nolock(ite, out);
+	}
+
+	void db_log_data::find_no_blob(
+		const std::string& key,
+		std::list<data_item_proto>& out)
+	{
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		map_index_iterator ite = index_.lower_bound(log_key_t(key, ""));
+		for (; ite != index_.end() && ite->first.first == key; ++ite) {
+			data_item_proto di;
+			di.set_time(ite->second.time);
+			di.set_ttl(ite->second.ttl);
+			di.set_title(ite->first.second);
+			di.set_data("");
+			out.push_back(di);
+		}
+	}
+
+	void db_log_data::remove_nolock(map_index_iterator ite) {
+		const log_key_t lk = ite->first;
+		// an older value could still be in an older segment
+		append_nolock(
+			RECORD_DELETE,
+			lk.first,
+			lk.second,
+			0,
+			0,
+			NULL,
+			0);
+		const uint32_t segment = ite->second.segment;
+		index_erase_nolock(ite);
+		if (segment_need_compaction_nolock(segment))
+			compact_cond_.notify_one();
+	}
+
+	void db_log_data::remove(
+		const std::string& key,
+		const std::string& title)
+	{
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		map_index_iterator ite = index_.find(log_key_t(key, title));
+		if (ite == index_.end()) return;
+		remove_nolock(ite);
+	}
+
+	void db_log_data::remove_oldest() {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		if (index_.empty()) return;
+		map_index_iterator oldest = index_.begin();
+		map_index_iterator ite;
+		for (ite = index_.begin(); ite != index_.end(); ++ite)
+			if (ite->second.time < oldest->second.time) oldest = ite;
+		remove_nolock(oldest);
+	}
+
+	void db_log_data::put_nolock(
+		const std::string& key,
+		const std::string& title,
+		const long long& time,
+		const long long& ttl,
+		const std::string& data)
+	{
+		uint64_t offset = append_nolock(
+			RECORD_PUT,
+			key,
+			title,
+			time,
+			ttl,
+			data.data(),
+			data.size());
+		log_location_t loc;
+		loc.segment = active_segment_;
+		loc.offset = offset;
+		loc.length = (uint32_t)(active_offset_ - offset);
+		loc.time = time;
+		loc.ttl = ttl;
+		log_key_t lk(key, title);
+		map_index_iterator ite = index_.find(lk);
+		const bool replaced = (ite != index_.end());
+		const uint32_t old_segment = replaced ? ite->second.segment : 0;
+		index_put_nolock(lk, loc);
+		if (replaced && segment_need_compaction_nolock(old_segment))
+			compact_cond_.notify_one();
+	}
+
+	void db_log_data::insert(
+		const std::string& key,
+		const std::string& title,
+		const long long& time,
+		const long long& ttl,
+		const std::string& data)
+	{
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		put_nolock(key, title, time, ttl, data);
+	}
+
+	void db_log_data::update(
+		const std::string& key,
+		const std::string& title,
+		const long long& time,
+		const long long& ttl)
+	{
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		map_index_iterator ite = index_.find(log_key_t(key, title));
+		if (ite == index_.end()) return;
+		append_nolock(
+			RECORD_TOUCH,
+			key,
+			title,
+			time,
+			ttl,
+			NULL,
+			0);
+		index_touch_nolock(ite, time, ttl);
+	}
+
+	size_t db_log_data::count(const std::string& key) {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		size_t nb = 0;
+		map_index_iterator ite = index_.lower_bound(log_key_t(key, ""));
+		for (; ite != index_.end() && ite->first.first == key; ++ite)
+			++nb;
+		return nb;
+	}
+
+	size_t db_log_data::size() {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		return index_.size();
+	}
+
+	void db_log_data::sync() {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		if (active_fd_ >= 0) fsync(active_fd_);
+	}
+
+	void db_log_data::list(std::multimap<std::string, data_item_proto>& out) {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		map_index_iterator ite;
+		for (ite = index_.begin(); ite != index_.end(); ++ite) {
+			data_item_proto di;
+			read_item_nolock(ite, di);
+			out.insert({ ite->first.first, di });
+		}
+	}
+
+	void db_log_data::list_headers(std::list<data_item_header_t>& ldh) {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		map_index_iterator ite;
+		for (ite = index_.begin(); ite != index_.end(); ++ite) {
+			data_item_header_t dh;
+			dh.key = ite->first.first;
+			dh.title = ite->first.second;
+			dh.time = ite->second.time;
+			dh.ttl = ite->second.ttl;
+			ldh.push_back(dh);
+		}
+	}
+
+	bool db_log_data::segment_need_compaction_nolock(uint32_t segment) const {
+		if (segment == active_segment_) return false;
+		std::map<uint32_t, uint64_t>::const_iterator its =
+			map_segment_size_.find(segment);
+		if (its == map_segment_size_.end() || !its->second) return false;
+		uint64_t live = 0;
+		std::map<uint32_t, uint64_t>::const_iterator itl =
+			map_segment_live_.find(segment);
+		if (itl != map_segment_live_.end()) live = itl->second;
+		return ((its->second - live) * 100) >= (its->second * compact_ratio_);
+	}
+
+	void db_log_data::purge_expired() {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		const long long now = now_time();
+		map_index_iterator ite = index_.begin();
+		while (ite != index_.end()) {
+			if (is_expired(ite->second.time, ite->second.ttl, now))
+				remove_nolock(ite++);
+			else
+				++ite;
+		}
+	}
+
+	void db_log_data::compact() {
+		boost::mutex::scoped_lock compact_it(compact_lock_);
+		purge_expired();
+		std::list<uint32_t> ls;
+		{
+			boost::mutex::scoped_lock lock_it(local_lock_);
+			std::map<uint32_t, uint64_t>::iterator ite;
+			for (ite = map_segment_size_.begin();
+				ite != map_segment_size_.end();
+				++ite)
+				if (segment_need_compaction_nolock(ite->first))
+					ls.push_back(ite->first);
+		}
+		std::list<uint32_t>::iterator ite;
+		for (ite = ls.begin(); ite != ls.end(); ++ite)
+			compact_segment(*ite);
+	}
+
+	void db_log_data::compact_segment(uint32_t segment) {
+		uint64_t size = 0;
+		{
+			boost::mutex::scoped_lock lock_it(local_lock_);
+			size = map_segment_size_[segment];
+		}
+		uint64_t offset = 0;
+		std::string buf;
+		// lock per record so that writers are not stalled by a compaction
+		while (offset + RECORD_HEADER_SIZE <= size) {
+			boost::mutex::scoped_lock lock_it(local_lock_);
+			int fd = segment_fd(segment);
+			buf.resize(RECORD_HEADER_SIZE);
+			if (pread(fd, &buf[0], RECORD_HEADER_SIZE, offset) !=
+				(long long)RECORD_HEADER_SIZE)
+				break;
+			if (get_u32(buf.data()) != RECORD_MAGIC) break;
+			uint64_t length = record_length(buf.data());
+			if (offset + length > size) break;
+			buf.resize((size_t)length);
+			if (pread(fd, &buf[0], (size_t)length, offset) != (long long)length)
+				break;
+			// never copy a damaged record forward with a fresh CRC
+			if (get_u32(&buf[4]) != checksum(&buf[8], (size_t)length - 8))
+				break;
+			record_t rec;
+			decode_record(buf, rec);
+			const bool has_older = map_segment_size_.begin()->first < segment;
+			log_key_t lk(rec.key, rec.title);
+			map_index_iterator ite = index_.find(lk);
+			switch (rec.type) {
+				case RECORD_PUT :
+					if ((ite != index_.end()) &&
+						(ite->second.segment == segment) &&
+						(ite->second.offset == offset))
+					{
+						// still alive copy it forward with its current time
+						uint64_t new_offset = append_nolock(
+							RECORD_PUT,
+							rec.key,
+							rec.title,
+							ite->second.time,
+							ite->second.ttl,
+							buf.data() + rec.data_offset,
+							rec.data_size);
+						map_segment_live_[segment] -= ite->second.length;
+						ite->second.segment = active_segment_;
+						ite->second.offset = new_offset;
+						ite->second.length =
+							(uint32_t)(active_offset_ - new_offset);
+						map_segment_live_[active_segment_] +=
+							ite->second.length;
+					}
+					break;
+				case RECORD_DELETE :
+					// only needed if an older segment can resurrect the value
+					if ((ite == index_.end()) && has_older)
+						append_nolock(
+							RECORD_DELETE,
+							rec.key,
+							rec.title,
+							0,
+							0,
+							NULL,
+							0);
+					break;
+				case RECORD_TOUCH :
+					// only needed if the value live in an older segment
+					if ((ite != index_.end()) &&
+						(ite->second.segment < segment))
+						append_nolock(
+							RECORD_TOUCH,
+							rec.key,
+							rec.title,
+							ite->second.time,
+							ite->second.ttl,
+							NULL,
+							0);
+					break;
+				default :
+					break;
+			}
+			offset += length;
+		}
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		if (offset < size) {
+			// what could not be read goes away with the segment
+			std::cerr
+				<< "Segment " << segment_path(segment)
+				<< " is damaged after offset " << offset << std::endl;
+			map_index_iterator ite = index_.begin();
+			while (ite != index_.end()) {
+				if (ite->second.segment == segment)
+					index_erase_nolock(ite++);
+				else
+					++ite;
+			}
+		}
+		// copies have to be on disk before the original goes away
+		fsync(active_fd_);
+		std::map<uint32_t, int>::iterator itf = map_segment_fd_.find(segment);
+		if (itf != map_segment_fd_.end()) {
+			::close(itf->second);
+			map_segment_fd_.erase(itf);
+		}
+		::remove(segment_path(segment).c_str());
+		map_segment_size_.erase(segment);
+		map_segment_live_.erase(segment);
+		save_index_nolock();
+	}
+
+	void db_log_data::compact_loop() {
+		boost::mutex::scoped_lock lock_it(local_lock_);
+		while (!compact_stop_) {
+			compact_cond_.timed_wait(
+				lock_it,
+				boost::posix_time::minutes(PERIODIC));
+			if (compact_stop_) break;
+			lock_it.unlock();
+			try {
+				compact();
+			} catch (std::exception& ex) {
+				std::cerr
+					<< "Exception in compact() : " << ex.what()
+					<< std::endl;
+			}
+			lock_it.lock();
+		}
+	}
+
+} // end namespace miniDHT
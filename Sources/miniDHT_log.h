@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2009-2019, Frederic DUBOUCHET
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the CERN nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Frederic DUBOUCHET ``AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL Frederic DUBOUCHET BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MINIDHT_LOG_HEADER_DEFINED
+#define MINIDHT_LOG_HEADER_DEFINED
+
+// STL
+#include <string>
+#include <map>
+#include <list>
+#include <stdint.h>
+// BOOST
+#include <boost/thread.hpp>
+// local
+#include "miniDHT_const.h"
+#include "miniDHT_db.h"
+
+namespace miniDHT {
+
+	// Append only storage engine, same interface as db_multi_key_data so
+	// that miniDHT can be built on either (MINIDHT_LOG_STORAGE).
+	// Records are appended to segment files (<prefix>.<id>.seg), the
+	// (key, title) -> (segment, offset) index is kept in memory and saved
+	// to <prefix>.idx so that an open only has to scan the segment tail.
+	// POSIX only (pread/pwrite).
+	class db_log_data {
+	public :
+		typedef std::pair<std::string, std::string> log_key_t;
+
+		struct log_location_t {
+			uint32_t segment;
+			uint64_t offset;
+			uint32_t length;
+			long long time;
+			long long ttl;
+		};
+
+		typedef std::map<log_key_t, log_location_t> map_index_t;
+		typedef map_index_t::iterator map_index_iterator;
+
+		enum record_type_t {
+			RECORD_PUT = 1,
+			RECORD_DELETE = 2,
+			RECORD_TOUCH = 3
+		};
+
+		// segment bigger than this are sealed and a new one is started
+		static const uint64_t DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+		// sealed segment with more dead bytes than this ratio get compacted
+		static const unsigned int DEFAULT_COMPACT_RATIO = 50;
+
+	protected :
+		std::string prefix_;
+		uint64_t max_segment_size_;
+		unsigned int compact_ratio_;
+		int active_fd_;
+		uint32_t active_segment_;
+		uint64_t active_offset_;
+		std::map<uint32_t, int> map_segment_fd_;
+		std::map<uint32_t, uint64_t> map_segment_size_;
+		std::map<uint32_t, uint64_t> map_segment_live_;
+		map_index_t index_;
+		boost::mutex local_lock_;
+		boost::mutex compact_lock_;
+		boost::condition_variable compact_cond_;
+		boost::thread* compact_thread_;
+		bool compact_stop_;
+
+	public :
+		db_log_data();
+		db_log_data(const std::string& prefix);
+		virtual ~db_log_data();
+
+	public :
+		void open(const std::string& prefix);
+		void close();
+		void clear();
+		void find(
+			const std::string& key,
+			std::list<data_item_proto>& out);
+		void find(
+			const std::string& key,
+			const std::string& title,
+			data_item_proto& out);
+		void find_no_blob(
+			const std::string& key,
+			std::list<data_item_proto>& out);
+		void remove(const std::string& key, const std::string& title);
+		void remove_oldest();
+		void insert(
+			const std::string& key,
+			const std::string& title,
+			const long long& time,
+			const long long& ttl,
+			const std::string& data);
+		void update(
+			const std::string& key,
+			const std::string& title,
+			const long long& time,
+			const long long& ttl);
+		size_t count(const std::string& key);
+		size_t size();
+		// rewrite the sealed segments that are mostly dead
+		void compact();
+		// make sure everything appended so far is on disk
+		void sync();
+		// debug
+		void list(std::multimap<std::string, data_item_proto>& out);
+		void list_headers(std::list<data_item_header_t>& ldh);
+
+	protected :
+		std::string segment_path(uint32_t segment) const;
+		std::string index_path() const;
+		int segment_fd(uint32_t segment);
+		void open_active(uint32_t segment);
+		uint64_t append_nolock(
+			record_type_t type,
+			const std::string& key,
+			const std::string& title,
+			const long long& time,
+			const long long& ttl,
+			const char* data,
+			size_t data_size);
+		// read the record at loc, throw if its magic or CRC does not match
+		void read_nolock(
+			const log_location_t& loc,
+			std::string& record);
+		void read_item_nolock(
+			map_index_iterator ite,
+			data_item_proto& out);
+		// every change of the index goes through index_*_nolock so that the
+		// live byte counts of the segments stay in step
+		void index_put_nolock(const log_key_t& lk, const log_location_t& loc);
+		void index_erase_nolock(map_index_iterator ite);
+		void index_touch_nolock(
+			map_index_iterator ite,
+			const long long& time,
+			const long long& ttl);
+		void index_clear_nolock();
+		void index_link_nolock(map_index_iterator ite);
+		void index_unlink_nolock(map_index_iterator ite);
+		void put_nolock(
+			const std::string& key,
+			const std::string& title,
+			const long long& time,
+			const long long& ttl,
+			const std::string& data);
+		void remove_nolock(map_index_iterator ite);
+		void scan_segment(uint32_t segment, uint64_t from, bool is_last);
+		bool load_index_buffer(
+			const std::string& buf,
+			uint32_t& mark_segment,
+			uint64_t& mark_offset);
+		void save_index_nolock();
+		bool segment_need_compaction_nolock(uint32_t segment) const;
+		void purge_expired();
+		void compact_segment(uint32_t segment);
+		void compact_loop();
+	};
+
+} // end namespace miniDHT
+
+#endif // MINIDHT_LOG_HEADER_DEFINED